@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replay a trigger6 stream capture at full speed and report per-frame
+ * transfer time.
+ *
+ *   echo 1 > /sys/kernel/debug/dri/N/capture_enable
+ *   cat /sys/kernel/debug/dri/N/capture > capture.bin
+ *   trigger6_replay capture.bin /sys/kernel/debug/dri/N/replay
+ *
+ * Each frame is handed to the target in a single write(), which returns
+ * once the driver has pushed all of its bulk transfers. Any other file,
+ * such as a pipe into a device emulator, can be used as the target.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trigger6_drm.h"
+
+struct frame {
+	size_t offset;
+	size_t length;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n] [-r repeat] [-q] <capture> [target]\n"
+		"  -n  parse only, do not write to a target\n"
+		"  -r  replay the capture this many times\n"
+		"  -q  only print the summary\n",
+		prog);
+	exit(2);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned char *read_capture(const char *path, size_t *size)
+{
+	unsigned char *data = NULL;
+	size_t len = 0, cap = 0;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	for (;;) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 1 << 20;
+			data = realloc(data, cap);
+			if (!data) {
+				perror("realloc");
+				close(fd);
+				return NULL;
+			}
+		}
+		n = read(fd, data + len, cap - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(path);
+			free(data);
+			close(fd);
+			return NULL;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+
+	close(fd);
+	*size = len;
+	return data;
+}
+
+/* Split the capture at frame markers, dropping anything before the first */
+static struct frame *index_frames(const unsigned char *data, size_t size,
+				  size_t *count)
+{
+	struct drm_trigger6_capture_record record;
+	struct frame *frames = NULL;
+	size_t offset = 0, n = 0, cap = 0;
+
+	while (offset + sizeof(record) <= size) {
+		memcpy(&record, data + offset, sizeof(record));
+		if (record.magic != TRIGGER6_CAPTURE_MAGIC ||
+		    record.length > size - offset - sizeof(record)) {
+			fprintf(stderr, "corrupt record at offset %zu\n",
+				offset);
+			break;
+		}
+
+		if (record.type == TRIGGER6_CAPTURE_FRAME) {
+			if (n == cap) {
+				cap = cap ? cap * 2 : 64;
+				frames = realloc(frames, cap * sizeof(*frames));
+				if (!frames) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			frames[n].offset = offset;
+			frames[n].length = 0;
+			n++;
+		}
+
+		offset += sizeof(record) + record.length;
+		if (n)
+			frames[n - 1].length = offset - frames[n - 1].offset;
+	}
+
+	*count = n;
+	return frames;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t start, ns, total_ns = 0, min_ns = UINT64_MAX, max_ns = 0;
+	size_t size, count, i, total_bytes = 0;
+	int dry_run = 0, quiet = 0, repeat = 1, fd = -1, opt, r;
+	struct frame *frames;
+	unsigned char *data;
+
+	while ((opt = getopt(argc, argv, "nr:q")) != -1) {
+		switch (opt) {
+		case 'n':
+			dry_run = 1;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			if (repeat < 1)
+				usage(argv[0]);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc || (!dry_run && optind + 2 != argc))
+		usage(argv[0]);
+
+	data = read_capture(argv[optind], &size);
+	if (!data)
+		return 1;
+
+	frames = index_frames(data, size, &count);
+	if (!count) {
+		fprintf(stderr, "no frames in capture\n");
+		return 1;
+	}
+
+	if (!dry_run) {
+		fd = open(argv[optind + 1], O_WRONLY);
+		if (fd < 0) {
+			perror(argv[optind + 1]);
+			return 1;
+		}
+	}
+
+	for (r = 0; r < repeat; r++) {
+		for (i = 0; i < count; i++) {
+			start = now_ns();
+			if (!dry_run && write(fd, data + frames[i].offset,
+					      frames[i].length) !=
+						(ssize_t)frames[i].length) {
+				perror("write");
+				return 1;
+			}
+			ns = now_ns() - start;
+
+			total_ns += ns;
+			total_bytes += frames[i].length;
+			if (ns < min_ns)
+				min_ns = ns;
+			if (ns > max_ns)
+				max_ns = ns;
+
+			if (!quiet)
+				printf("frame %zu: %zu bytes %.3f ms %.1f MB/s\n",
+				       i, frames[i].length, ns / 1e6,
+				       ns ? frames[i].length * 1e3 / ns : 0.0);
+		}
+	}
+
+	printf("%zu frames, %zu bytes: min %.3f ms avg %.3f ms max %.3f ms, %.1f MB/s\n",
+	       count * repeat, total_bytes, min_ns / 1e6,
+	       total_ns / 1e6 / (count * repeat), max_ns / 1e6,
+	       total_ns ? total_bytes * 1e3 / total_ns : 0.0);
+
+	if (fd >= 0)
+		close(fd);
+	free(frames);
+	free(data);
+	return 0;
+}
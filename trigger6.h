@@ -1,12 +1,17 @@
 #ifndef TRIGGER6_H
 #define TRIGGER6_H
 
+#include <linux/kfifo.h>
 #include <linux/mm_types.h>
+#include <linux/mutex.h>
+#include <linux/uio.h>
 #include <linux/usb.h>
+#include <linux/workqueue.h>
 
 #include <drm/drm_device.h>
 #include <drm/drm_framebuffer.h>
 #include <drm/drm_gem.h>
+#include <drm/drm_rect.h>
 #include <drm/drm_simple_kms_helper.h>
 
 #define DRIVER_NAME "trigger6"
@@ -21,7 +26,19 @@
 #define TRIGGER6_ENDPOINT_BULK_OUT	0x2
 #define TRIGGER6_ENDPOINT_INTERRUPT_IN	0x3
 
-#define TRIGGER6_MAX_TRANSFER_LENGTH 0x19000
+#define TRIGGER6_DEFAULT_TRANSFER_LENGTH 0x19000
+#define TRIGGER6_MIN_TRANSFER_LENGTH 0x1000
+#define TRIGGER6_MAX_TRANSFER_LENGTH 0x80000
+
+/* Damage rects per update, and the per-rect cost used to merge them */
+#define TRIGGER6_MAX_RECTS 16
+#define TRIGGER6_RECT_OVERHEAD 1024
+
+/* Output tile edge for the rotating converter */
+#define TRIGGER6_TILE_SIZE 64U
+
+#define TRIGGER6_DEFAULT_URB_DEPTH 4
+#define TRIGGER6_MAX_URB_DEPTH 32
 
 struct trigger6_mode {
 	u32 pixel_clock_khz;
@@ -73,6 +90,13 @@ struct trigger6_video_header {
 	__le32 unk13;
 } __attribute__((packed));
 
+struct trigger6_urb {
+	struct trigger6_device *parent;
+	struct urb *session_urb;
+	struct urb *urb;
+	struct list_head entry;
+};
+
 struct trigger6_device {
 	struct drm_device drm;
 	struct usb_interface *intf;
@@ -83,6 +107,8 @@ struct trigger6_device {
 	struct drm_simple_display_pipe display_pipe;
 
 	struct trigger6_mode modes[30];
+	/* EDID modes were last probed from, rechecked on resume */
+	const struct drm_edid *edid;
 
 	// TODO figure if needed
 	struct completion transfer_done;
@@ -91,25 +117,108 @@ struct trigger6_device {
 	struct list_head urb_available_list;
 	spinlock_t urb_available_list_lock;
 	struct semaphore urb_available_list_sem;
+	struct usb_anchor urb_anchor;
+	size_t urb_length;
+	u32 urb_pool_depth;
+	int transfer_status;
+
+	/* Requested transfer shape, applied on the next payload */
+	u32 fragment_length;
+	u32 urb_depth;
+	bool autotune;
+	struct work_struct autotune_work;
+	u64 last_frame_ns;
+	u64 last_frame_bytes;
+
+	/* Serialises session/fragment streams on the bulk endpoint */
+	struct mutex transfer_lock;
+
+	/*
+	 * Last frame and output state, kept across suspend. The output state
+	 * is also written under transfer_lock so that sends can check it.
+	 */
+	struct mutex frame_lock;
+	struct trigger6_video_header frame_header;
+	void *frame_buffer;
+	size_t frame_buffer_size;
+	size_t frame_length;
+	unsigned int frame_rotation;
+	void *partial_buffer;
+	size_t partial_buffer_size;
+	struct trigger6_mode *current_mode;
+	bool output_enabled;
+	bool suspended;
+	bool disconnected;
+
+	/* Stream capture and replay, see trigger6_debugfs.c */
+	struct mutex capture_lock;
+	struct kfifo capture_fifo;
+	void *capture_buffer;
+	bool capture_enabled;
+	bool capture_skip_frame;
+	u32 capture_frame;
+	u64 capture_dropped;
+	u64 replay_frames;
+	u64 replay_bytes;
+	u64 replay_total_ns;
+	u64 replay_last_ns;
+	u64 replay_min_ns;
+	u64 replay_max_ns;
 };
 
 #define to_trigger6(x) container_of(x, struct trigger6_device, drm)
 
 int trigger6_read_byte(struct trigger6_device *trigger6, u16 address);
 int trigger6_connector_init(struct trigger6_device *trigger6);
+bool trigger6_connector_edid_changed(struct trigger6_device *trigger6);
 int trigger6_set_resolution(struct trigger6_device *trigger6,
 			    struct trigger6_mode *mode);
 
 int trigger6_read_modes(struct trigger6_device *trigger6, int output_index, int byte_offset, void* data, int length);
 int trigger6_read_connector_status(struct trigger6_device *trigger6, int output_index);
 void trigger6_free_urb(struct trigger6_device *trigger6);
-int trigger6_init_urb(struct trigger6_device *trigger6, size_t total_size);
+int trigger6_init_urb(struct trigger6_device *trigger6, int depth,
+		      size_t length);
 int trigger6_enable_output(struct trigger6_device *trigger6);
 int trigger6_disable_output(struct trigger6_device *trigger6);
 
-void trigger6_fb_send_rect(struct drm_framebuffer *fb,
-			   const struct iosys_map *map, struct drm_rect *rect);
+void trigger6_xrgb8888_to_bgr24_blocked(void *dst, unsigned int dst_width,
+					unsigned int dst_height,
+					const void *src,
+					unsigned int src_pitch,
+					unsigned int rotation);
+
+/* Produce payload bytes [offset, offset + length) in place before sending */
+typedef void (*trigger6_fill_fn)(void *data, size_t offset, size_t length);
+
+void trigger6_init_video_header(struct trigger6_video_header *header,
+				u32 format, u16 width, u16 height,
+				size_t data_length);
+int trigger6_transfer_begin(struct trigger6_device *trigger6,
+			    size_t min_length);
+struct urb *trigger6_get_urb(struct trigger6_device *trigger6);
+int trigger6_submit_urb(struct trigger6_device *trigger6, struct urb *urb);
+int trigger6_wait_urbs(struct trigger6_device *trigger6);
+int trigger6_send_payload(struct trigger6_device *trigger6,
+			  const struct kvec *vec, unsigned int nr_segs);
+int trigger6_stream_payload(struct trigger6_device *trigger6,
+			    const struct kvec *vec, unsigned int nr_segs,
+			    trigger6_fill_fn fill, void *data);
+int trigger6_send_frame(struct trigger6_device *trigger6);
+void trigger6_set_output_state(struct trigger6_device *trigger6, bool enabled,
+			       bool disconnected);
+int trigger6_send_rects(struct trigger6_device *trigger6, int frame_width,
+			const struct drm_rect *rects, int nr_rects);
+void trigger6_transfer_init(struct trigger6_device *trigger6);
+
+int trigger6_capture_init(struct trigger6_device *trigger6);
+void trigger6_capture_frame(struct trigger6_device *trigger6,
+			    size_t payload_length, size_t fragment_length);
+void trigger6_capture(struct trigger6_device *trigger6, u32 type,
+		      const void *data, u32 length);
+void trigger6_debugfs_init(struct drm_minor *minor);
+
+int trigger6_submit_frame_ioctl(struct drm_device *dev, void *data,
+				struct drm_file *file);
 
-void trigger6_free_urb(struct trigger6_device *trigger6);
-int trigger6_init_urb(struct trigger6_device *trigger6, size_t total_size);
 #endif
@@ -29,20 +29,59 @@ static int trigger6_connector_get_modes(struct drm_connector *connector)
 {
 	int ret;
 	struct trigger6_device *trigger6 = to_trigger6(connector->dev);
-	const struct drm_edid *edid;
-	edid = drm_edid_read_custom(connector, trigger6_read_edid, trigger6);
-	if (!edid)
+
+	/* Always probe the sink, the cached copy only serves resume */
+	drm_edid_free(trigger6->edid);
+	trigger6->edid = drm_edid_read_custom(connector, trigger6_read_edid,
+					      trigger6);
+	if (!trigger6->edid)
 		return 0;
-	ret = drm_edid_connector_update(connector, edid);
+	ret = drm_edid_connector_update(connector, trigger6->edid);
 	if (ret < 0) {
-		ret = 0;
-		goto err_free_edid;
+		drm_edid_free(trigger6->edid);
+		trigger6->edid = NULL;
+		return 0;
 	}
-	ret = drm_edid_connector_add_modes(connector);
+	return drm_edid_connector_add_modes(connector);
+}
 
-err_free_edid:
-	drm_edid_free(edid);
-	return ret;
+static bool trigger6_edid_equal(const struct drm_edid *a,
+				const struct drm_edid *b)
+{
+	const struct edid *raw_a = drm_edid_raw(a), *raw_b = drm_edid_raw(b);
+
+	if (!raw_a || !raw_b)
+		return raw_a == raw_b;
+
+	return raw_a->extensions == raw_b->extensions &&
+	       !memcmp(raw_a, raw_b, (raw_a->extensions + 1) * EDID_LENGTH);
+}
+
+/*
+ * Read the sink's EDID again and compare it with the one modes were last
+ * probed from. When the sink changed, for example while suspended, the
+ * cached copy is dropped and true is returned.
+ */
+bool trigger6_connector_edid_changed(struct trigger6_device *trigger6)
+{
+	struct drm_device *dev = &trigger6->drm;
+	const struct drm_edid *edid;
+	bool changed = false;
+
+	mutex_lock(&dev->mode_config.mutex);
+	if (trigger6->edid) {
+		edid = drm_edid_read_custom(&trigger6->connector,
+					    trigger6_read_edid, trigger6);
+		changed = !trigger6_edid_equal(edid, trigger6->edid);
+		drm_edid_free(edid);
+		if (changed) {
+			drm_edid_free(trigger6->edid);
+			trigger6->edid = NULL;
+		}
+	}
+	mutex_unlock(&dev->mode_config.mutex);
+
+	return changed;
 }
 
 static enum drm_connector_status trigger6_detect(struct drm_connector *connector,
@@ -56,7 +95,32 @@ static enum drm_connector_status trigger6_detect(struct drm_connector *connector
 	if (status < 0)
 		return connector_status_unknown;
 
-	return status == 1 ? connector_status_connected : connector_status_disconnected;
+	if (status != 1) {
+		drm_edid_free(trigger6->edid);
+		trigger6->edid = NULL;
+		mutex_lock(&trigger6->frame_lock);
+		if (!trigger6->disconnected)
+			trigger6_set_output_state(trigger6,
+						  trigger6->output_enabled, true);
+		mutex_unlock(&trigger6->frame_lock);
+		return connector_status_disconnected;
+	}
+
+	mutex_lock(&trigger6->frame_lock);
+	if (trigger6->disconnected)
+		trigger6_set_output_state(trigger6, trigger6->output_enabled,
+					  false);
+	mutex_unlock(&trigger6->frame_lock);
+	return connector_status_connected;
+}
+
+static void trigger6_connector_destroy(struct drm_connector *connector)
+{
+	struct trigger6_device *trigger6 = to_trigger6(connector->dev);
+
+	drm_edid_free(trigger6->edid);
+	trigger6->edid = NULL;
+	drm_connector_cleanup(connector);
 }
 
 static const struct drm_connector_helper_funcs trigger6_connector_helper_funcs = {
@@ -65,7 +129,7 @@ static const struct drm_connector_helper_funcs trigger6_connector_helper_funcs =
 
 static const struct drm_connector_funcs trigger6_connector_funcs = {
 	.fill_modes = drm_helper_probe_single_connector_modes,
-	.destroy = drm_connector_cleanup,
+	.destroy = trigger6_connector_destroy,
 	.detect = trigger6_detect,
 	.reset = drm_atomic_helper_connector_reset,
 	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <drm/drm_blend.h>
+
+#include "trigger6.h"
+
+/*
+ * Source pixel shown at (dx, dy) of the output, following drm_rect_rotate():
+ * the reflection is applied first, then the counter-clockwise rotation.
+ * src_width and src_height are the size of the unrotated source.
+ */
+static void trigger6_rotate_point(unsigned int rotation, long src_width,
+				  long src_height, long dx, long dy, long *sx,
+				  long *sy)
+{
+	switch (rotation & DRM_MODE_ROTATE_MASK) {
+	case DRM_MODE_ROTATE_90:
+		*sx = src_width - 1 - dy;
+		*sy = dx;
+		break;
+	case DRM_MODE_ROTATE_180:
+		*sx = src_width - 1 - dx;
+		*sy = src_height - 1 - dy;
+		break;
+	case DRM_MODE_ROTATE_270:
+		*sx = dy;
+		*sy = src_height - 1 - dx;
+		break;
+	default:
+		*sx = dx;
+		*sy = dy;
+		break;
+	}
+
+	if (rotation & DRM_MODE_REFLECT_X)
+		*sx = src_width - 1 - *sx;
+	if (rotation & DRM_MODE_REFLECT_Y)
+		*sy = src_height - 1 - *sy;
+}
+
+static long trigger6_src_offset(unsigned int rotation, long src_width,
+				long src_height, unsigned int src_pitch,
+				long dx, long dy)
+{
+	long sx, sy;
+
+	trigger6_rotate_point(rotation, src_width, src_height, dx, dy, &sx,
+			      &sy);
+	return sy * src_pitch + sx * 4;
+}
+
+/*
+ * Convert XRGB8888 to the device's BGR24 one cache-sized tile at a time,
+ * rotating and reflecting in the same pass. Walking the output in tiles
+ * keeps the source lines a tile touches resident even when rotation makes
+ * it step down columns.
+ *
+ * src points at the top-left pixel of the unrotated source rectangle,
+ * which is dst_height x dst_width for 90/270 degrees and dst_width x
+ * dst_height otherwise. The output is tightly packed.
+ */
+void trigger6_xrgb8888_to_bgr24_blocked(void *dst, unsigned int dst_width,
+					unsigned int dst_height,
+					const void *src,
+					unsigned int src_pitch,
+					unsigned int rotation)
+{
+	size_t dst_pitch = dst_width * 3;
+	long src_width = dst_width, src_height = dst_height;
+	long origin, step_x, step_y;
+	unsigned int tx, ty, x, y, w, h;
+	const u8 *s;
+	u8 *d;
+	u32 pix;
+
+	if (drm_rotation_90_or_270(rotation))
+		swap(src_width, src_height);
+
+	/* The mapping is affine, so each output step is a fixed src step */
+	origin = trigger6_src_offset(rotation, src_width, src_height,
+				     src_pitch, 0, 0);
+	step_x = trigger6_src_offset(rotation, src_width, src_height,
+				     src_pitch, 1, 0) - origin;
+	step_y = trigger6_src_offset(rotation, src_width, src_height,
+				     src_pitch, 0, 1) - origin;
+
+	for (ty = 0; ty < dst_height; ty += TRIGGER6_TILE_SIZE) {
+		h = min(dst_height - ty, TRIGGER6_TILE_SIZE);
+		for (tx = 0; tx < dst_width; tx += TRIGGER6_TILE_SIZE) {
+			w = min(dst_width - tx, TRIGGER6_TILE_SIZE);
+			for (y = ty; y < ty + h; y++) {
+				s = src + origin + y * step_y + tx * step_x;
+				d = dst + y * dst_pitch + tx * 3;
+				for (x = 0; x < w; x++, s += step_x, d += 3) {
+					pix = le32_to_cpup((const __le32 *)s);
+					d[0] = pix;
+					d[1] = pix >> 8;
+					d[2] = pix >> 16;
+				}
+			}
+		}
+	}
+}
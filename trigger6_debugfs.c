@@ -0,0 +1,465 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/debugfs.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include <drm/drm_debugfs.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_file.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_print.h>
+
+#include "trigger6.h"
+#include "trigger6_drm.h"
+
+static unsigned int capture_size_kb;
+module_param(capture_size_kb, uint, 0644);
+MODULE_PARM_DESC(capture_size_kb,
+		 "Size of the stream capture ring buffer (0 = one largest frame)");
+
+/* Largest capture ring, in KiB */
+#define TRIGGER6_CAPTURE_MAX_KB (SZ_1G / SZ_1K)
+
+/* Largest single write accepted by the replay file */
+#define TRIGGER6_REPLAY_MAX_WRITE SZ_64M
+
+static void trigger6_capture_push(struct trigger6_device *trigger6, u32 type,
+				  const void *data, u32 length)
+{
+	struct drm_trigger6_capture_record record = {
+		.magic = TRIGGER6_CAPTURE_MAGIC,
+		.type = type,
+		.length = length,
+		.frame = trigger6->capture_frame,
+		.timestamp_ns = ktime_get_ns(),
+	};
+
+	/* Room for the whole frame was checked at its marker */
+	if (trigger6->capture_skip_frame ||
+	    WARN_ON(kfifo_avail(&trigger6->capture_fifo) <
+		    sizeof(record) + length))
+		return;
+
+	kfifo_in(&trigger6->capture_fifo, &record, sizeof(record));
+	if (length)
+		kfifo_in(&trigger6->capture_fifo, data, length);
+}
+
+/* Ring space taken by one captured frame, records included */
+static size_t trigger6_capture_frame_size(size_t payload_length,
+					  size_t fragment_length)
+{
+	size_t fragments = DIV_ROUND_UP(payload_length, fragment_length);
+
+	return sizeof(struct drm_trigger6_capture_record) +
+	       fragments * (2 * sizeof(struct drm_trigger6_capture_record) +
+			    sizeof(struct trigger6_session)) +
+	       payload_length;
+}
+
+/*
+ * Start capturing a frame of payload_length bytes sent in fragments of
+ * fragment_length. Frames that do not fit in the ring are skipped whole.
+ */
+void trigger6_capture_frame(struct trigger6_device *trigger6,
+			    size_t payload_length, size_t fragment_length)
+{
+	size_t size;
+
+	if (!READ_ONCE(trigger6->capture_enabled))
+		return;
+
+	size = trigger6_capture_frame_size(payload_length, fragment_length);
+
+	mutex_lock(&trigger6->capture_lock);
+	if (trigger6->capture_enabled) {
+		trigger6->capture_frame++;
+		trigger6->capture_skip_frame =
+			kfifo_avail(&trigger6->capture_fifo) < size;
+		if (trigger6->capture_skip_frame)
+			trigger6->capture_dropped++;
+		else
+			trigger6_capture_push(trigger6, TRIGGER6_CAPTURE_FRAME,
+					      NULL, 0);
+	}
+	mutex_unlock(&trigger6->capture_lock);
+}
+
+void trigger6_capture(struct trigger6_device *trigger6, u32 type,
+		      const void *data, u32 length)
+{
+	if (!READ_ONCE(trigger6->capture_enabled))
+		return;
+
+	mutex_lock(&trigger6->capture_lock);
+	if (trigger6->capture_enabled)
+		trigger6_capture_push(trigger6, type, data, length);
+	mutex_unlock(&trigger6->capture_lock);
+}
+
+/* Payload of a full frame in the largest mode the device reports */
+static size_t trigger6_largest_frame(struct trigger6_device *trigger6)
+{
+	size_t size, largest = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(trigger6->modes); i++) {
+		size = sizeof(struct trigger6_video_header) +
+		       (size_t)trigger6->modes[i].line_active_pixels *
+			       trigger6->modes[i].frame_active_lines * 3;
+		largest = max(largest, size);
+	}
+
+	return largest;
+}
+
+static int trigger6_capture_enable_get(void *data, u64 *val)
+{
+	struct trigger6_device *trigger6 = data;
+
+	*val = trigger6->capture_enabled;
+	return 0;
+}
+
+static int trigger6_capture_enable_set(void *data, u64 val)
+{
+	struct trigger6_device *trigger6 = data;
+	size_t size, frame_size;
+	void *buffer;
+	int ret = 0;
+
+	mutex_lock(&trigger6->capture_lock);
+	if (!val) {
+		WRITE_ONCE(trigger6->capture_enabled, false);
+		goto unlock;
+	}
+
+	/* Every enable starts a fresh capture */
+	vfree(trigger6->capture_buffer);
+	trigger6->capture_buffer = NULL;
+	WRITE_ONCE(trigger6->capture_enabled, false);
+
+	/* The ring has to hold at least one frame of the largest mode */
+	frame_size = trigger6_capture_frame_size(
+		trigger6_largest_frame(trigger6), TRIGGER6_MIN_TRANSFER_LENGTH);
+	if (capture_size_kb > TRIGGER6_CAPTURE_MAX_KB) {
+		drm_err(&trigger6->drm, "capture ring above %d KiB\n",
+			TRIGGER6_CAPTURE_MAX_KB);
+		ret = -EINVAL;
+		goto unlock;
+	} else if (capture_size_kb) {
+		size = rounddown_pow_of_two(
+			(size_t)max(capture_size_kb, 4U) * SZ_1K);
+		if (size < frame_size) {
+			drm_err(&trigger6->drm,
+				"capture ring of %zu bytes cannot hold a %zu byte frame\n",
+				size, frame_size);
+			ret = -ENOSPC;
+			goto unlock;
+		}
+	} else {
+		size = roundup_pow_of_two(frame_size);
+	}
+
+	buffer = vmalloc(size);
+	if (!buffer) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+	ret = kfifo_init(&trigger6->capture_fifo, buffer, size);
+	if (ret) {
+		vfree(buffer);
+		goto unlock;
+	}
+
+	trigger6->capture_buffer = buffer;
+	trigger6->capture_frame = 0;
+	trigger6->capture_dropped = 0;
+	/* Start recording at the next frame boundary */
+	trigger6->capture_skip_frame = true;
+	WRITE_ONCE(trigger6->capture_enabled, true);
+unlock:
+	mutex_unlock(&trigger6->capture_lock);
+	return ret;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(trigger6_capture_enable_fops,
+			 trigger6_capture_enable_get,
+			 trigger6_capture_enable_set, "%llu\n");
+
+static ssize_t trigger6_capture_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct trigger6_device *trigger6 = file->private_data;
+	unsigned int copied = 0;
+	int ret = 0;
+
+	mutex_lock(&trigger6->capture_lock);
+	if (trigger6->capture_buffer)
+		ret = kfifo_to_user(&trigger6->capture_fifo, buf, count,
+				    &copied);
+	mutex_unlock(&trigger6->capture_lock);
+
+	return ret ? ret : copied;
+}
+
+static const struct file_operations trigger6_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = trigger6_capture_read,
+};
+
+static void trigger6_replay_account(struct trigger6_device *trigger6,
+				    ktime_t start, size_t bytes)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	trigger6->replay_frames++;
+	trigger6->replay_bytes += bytes;
+	trigger6->replay_total_ns += ns;
+	trigger6->replay_last_ns = ns;
+	if (!trigger6->replay_min_ns || ns < trigger6->replay_min_ns)
+		trigger6->replay_min_ns = ns;
+	if (ns > trigger6->replay_max_ns)
+		trigger6->replay_max_ns = ns;
+}
+
+/*
+ * Check a replay write before anything is sent: every record is complete,
+ * every fragment follows its session header and fits the URB pool.
+ * Returns the longest fragment.
+ */
+static ssize_t trigger6_replay_scan(const void *buf, size_t count)
+{
+	struct drm_trigger6_capture_record record;
+	size_t offset = 0, max_length = 0;
+	bool session = false;
+
+	while (offset < count) {
+		if (count - offset < sizeof(record))
+			return -EINVAL;
+		memcpy(&record, buf + offset, sizeof(record));
+		offset += sizeof(record);
+		if (record.magic != TRIGGER6_CAPTURE_MAGIC ||
+		    record.length > count - offset)
+			return -EINVAL;
+
+		switch (record.type) {
+		case TRIGGER6_CAPTURE_FRAME:
+			session = false;
+			break;
+		case TRIGGER6_CAPTURE_SESSION:
+			if (record.length != sizeof(struct trigger6_session))
+				return -EINVAL;
+			session = true;
+			break;
+		case TRIGGER6_CAPTURE_FRAGMENT:
+			if (!session ||
+			    record.length > TRIGGER6_MAX_TRANSFER_LENGTH)
+				return -EINVAL;
+			max_length = max_t(size_t, max_length, record.length);
+			session = false;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		offset += record.length;
+	}
+
+	return max_length;
+}
+
+/*
+ * Send captured records back to the device as fast as possible, through
+ * the same URB pool and in-flight depth as live frames. Only the bulk
+ * transfers are timed, so the numbers are free of conversion cost.
+ */
+static ssize_t trigger6_replay_write(struct file *file,
+				     const char __user *ubuf, size_t count,
+				     loff_t *ppos)
+{
+	struct trigger6_device *trigger6 = file->private_data;
+	struct drm_trigger6_capture_record record;
+	struct trigger6_urb *urb_entry;
+	const void *session = NULL;
+	size_t offset = 0, frame_bytes = 0;
+	bool in_frame = false;
+	ktime_t start = 0;
+	struct urb *urb;
+	ssize_t max_length;
+	void *buf;
+	int ret, err, idx;
+
+	if (count > TRIGGER6_REPLAY_MAX_WRITE)
+		return -E2BIG;
+
+	buf = vmemdup_user(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	max_length = trigger6_replay_scan(buf, count);
+	if (max_length < 0) {
+		ret = max_length;
+		goto free_buf;
+	}
+
+	if (!drm_dev_enter(&trigger6->drm, &idx)) {
+		ret = -ENODEV;
+		goto free_buf;
+	}
+
+	mutex_lock(&trigger6->frame_lock);
+	mutex_lock(&trigger6->transfer_lock);
+	ret = trigger6_transfer_begin(trigger6, max_length);
+	if (ret)
+		goto unlock;
+
+	while (offset < count) {
+		memcpy(&record, buf + offset, sizeof(record));
+		offset += sizeof(record);
+
+		switch (record.type) {
+		case TRIGGER6_CAPTURE_FRAME:
+			if (in_frame) {
+				ret = trigger6_wait_urbs(trigger6);
+				if (ret < 0)
+					break;
+				trigger6_replay_account(trigger6, start,
+							frame_bytes);
+			}
+			in_frame = true;
+			frame_bytes = 0;
+			start = ktime_get();
+			break;
+		case TRIGGER6_CAPTURE_SESSION:
+			session = buf + offset;
+			break;
+		case TRIGGER6_CAPTURE_FRAGMENT:
+			urb = trigger6_get_urb(trigger6);
+			if (IS_ERR(urb)) {
+				ret = PTR_ERR(urb);
+				break;
+			}
+			urb_entry = urb->context;
+			memcpy(urb_entry->session_urb->transfer_buffer, session,
+			       sizeof(struct trigger6_session));
+			memcpy(urb->transfer_buffer, buf + offset,
+			       record.length);
+			urb->transfer_buffer_length = record.length;
+			ret = trigger6_submit_urb(trigger6, urb);
+			frame_bytes += sizeof(struct trigger6_session) +
+				       record.length;
+			break;
+		}
+		if (ret < 0)
+			break;
+
+		offset += record.length;
+	}
+
+	err = trigger6_wait_urbs(trigger6);
+	if (!ret)
+		ret = err;
+	if (in_frame && ret >= 0)
+		trigger6_replay_account(trigger6, start, frame_bytes);
+
+	/* The device no longer shows the staged frame */
+	trigger6->frame_length = 0;
+unlock:
+	mutex_unlock(&trigger6->transfer_lock);
+	mutex_unlock(&trigger6->frame_lock);
+	drm_dev_exit(idx);
+free_buf:
+	kvfree(buf);
+	return ret < 0 ? ret : count;
+}
+
+static const struct file_operations trigger6_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = trigger6_replay_write,
+};
+
+static int trigger6_stats_show(struct seq_file *m, void *unused)
+{
+	struct trigger6_device *trigger6 = m->private;
+
+	mutex_lock(&trigger6->capture_lock);
+	seq_printf(m, "capture_frames: %u\n", trigger6->capture_frame);
+	seq_printf(m, "capture_dropped: %llu\n", trigger6->capture_dropped);
+	seq_printf(m, "capture_pending: %u\n",
+		   trigger6->capture_buffer ?
+			   kfifo_len(&trigger6->capture_fifo) : 0);
+	mutex_unlock(&trigger6->capture_lock);
+
+	mutex_lock(&trigger6->transfer_lock);
+	seq_printf(m, "fragment_length: %zu\n", trigger6->urb_length);
+	seq_printf(m, "urb_depth: %d\n", trigger6->num_urbs);
+	seq_printf(m, "last_frame_bytes: %llu\n", trigger6->last_frame_bytes);
+	seq_printf(m, "last_frame_ns: %llu\n", trigger6->last_frame_ns);
+	seq_printf(m, "replay_frames: %llu\n", trigger6->replay_frames);
+	seq_printf(m, "replay_bytes: %llu\n", trigger6->replay_bytes);
+	seq_printf(m, "replay_last_ns: %llu\n", trigger6->replay_last_ns);
+	seq_printf(m, "replay_min_ns: %llu\n", trigger6->replay_min_ns);
+	seq_printf(m, "replay_max_ns: %llu\n", trigger6->replay_max_ns);
+	seq_printf(m, "replay_avg_ns: %llu\n",
+		   trigger6->replay_frames ?
+			   div64_u64(trigger6->replay_total_ns,
+				     trigger6->replay_frames) :
+			   0);
+	mutex_unlock(&trigger6->transfer_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(trigger6_stats);
+
+static void trigger6_capture_release(struct drm_device *dev, void *unused)
+{
+	struct trigger6_device *trigger6 = to_trigger6(dev);
+
+	vfree(trigger6->capture_buffer);
+	trigger6->capture_buffer = NULL;
+}
+
+int trigger6_capture_init(struct trigger6_device *trigger6)
+{
+	int ret;
+
+	ret = drmm_mutex_init(&trigger6->drm, &trigger6->capture_lock);
+	if (ret)
+		return ret;
+
+	return drmm_add_action_or_reset(&trigger6->drm,
+					trigger6_capture_release, NULL);
+}
+
+void trigger6_debugfs_init(struct drm_minor *minor)
+{
+	struct trigger6_device *trigger6 = to_trigger6(minor->dev);
+	struct dentry *root = minor->debugfs_root;
+
+	debugfs_create_file_unsafe("capture_enable", 0600, root, trigger6,
+				   &trigger6_capture_enable_fops);
+	debugfs_create_file("capture", 0400, root, trigger6,
+			    &trigger6_capture_fops);
+	debugfs_create_file("replay", 0200, root, trigger6,
+			    &trigger6_replay_fops);
+	debugfs_create_file("stream_stats", 0400, root, trigger6,
+			    &trigger6_stats_fops);
+
+	/* Requested values; stream_stats shows the ones in use */
+	debugfs_create_u32("fragment_length", 0644, root,
+			   &trigger6->fragment_length);
+	debugfs_create_u32("urb_depth", 0644, root, &trigger6->urb_depth);
+	debugfs_create_bool("autotune", 0644, root, &trigger6->autotune);
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+#ifndef TRIGGER6_DRM_H
+#define TRIGGER6_DRM_H
+
+#include <drm/drm.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define DRM_TRIGGER6_SUBMIT_FRAME	0x00
+
+/* Image formats understood by the device, see trigger6_video_header */
+#define DRM_TRIGGER6_FORMAT_NV12	0x6
+#define DRM_TRIGGER6_FORMAT_JPEG	0xD
+
+/*
+ * Stream a frame that is already encoded in one of the device formats.
+ * The bytes at [offset, offset + size) of the GEM object are sent to the
+ * device as-is behind a video header, without any CPU pixel processing.
+ */
+struct drm_trigger6_submit_frame {
+	__u32 handle;	/* GEM handle holding the frame */
+	__u32 format;	/* DRM_TRIGGER6_FORMAT_* */
+	__u32 width;
+	__u32 height;
+	__u32 offset;	/* byte offset of the frame in the GEM object */
+	__u32 size;	/* frame size in bytes */
+};
+
+#define DRM_IOCTL_TRIGGER6_SUBMIT_FRAME                                  \
+	DRM_IOW(DRM_COMMAND_BASE + DRM_TRIGGER6_SUBMIT_FRAME,          \
+		struct drm_trigger6_submit_frame)
+
+/*
+ * Stream capture, read from debugfs "capture" and written back to "replay".
+ * Each record header is followed by length bytes of data: nothing for a
+ * frame marker, a trigger6_session for a session record and the raw bulk
+ * data for a fragment record.
+ */
+#define TRIGGER6_CAPTURE_MAGIC		0x36475254 /* "TRG6" */
+
+#define TRIGGER6_CAPTURE_FRAME		0x1
+#define TRIGGER6_CAPTURE_SESSION	0x2
+#define TRIGGER6_CAPTURE_FRAGMENT	0x3
+
+struct drm_trigger6_capture_record {
+	__u32 magic;
+	__u32 type;	/* TRIGGER6_CAPTURE_* */
+	__u32 length;	/* bytes of data following this header */
+	__u32 frame;	/* frame sequence number */
+	__u64 timestamp_ns;
+};
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -1,12 +1,15 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <linux/iosys-map.h>
 #include <linux/module.h>
 #include <linux/vmalloc.h>
 
 #include <drm/drm_atomic_helper.h>
+#include <drm/drm_blend.h>
 #include <drm/drm_crtc_helper.h>
 #include <drm/drm_damage_helper.h>
 #include <drm/drm_drv.h>
+#include <drm/drm_edid.h>
 #include <drm/drm_fb_helper.h>
 #include <drm/drm_format_helper.h>
 #include <drm/drm_fbdev_ttm.h>
@@ -21,20 +24,86 @@
 #include <drm/drm_simple_kms_helper.h>
 
 #include "trigger6.h"
+#include "trigger6_drm.h"
 
+static bool partial_updates;
+module_param(partial_updates, bool, 0644);
+MODULE_PARM_DESC(partial_updates,
+		 "Send only damaged rects (experimental, guessed protocol)");
+
+/*
+ * Suspend and resume leave the atomic state alone instead of replaying a
+ * full modeset. The staging buffer, mode and EDID stay cached, so resume
+ * only has to reprogram the output and resend the last frame. The sink
+ * may have been swapped in the meantime, so its EDID is checked again and
+ * userspace is told to reprobe when it differs.
+ */
 static int trigger6_usb_suspend(struct usb_interface *interface,
 				pm_message_t message)
 {
-	struct drm_device *dev = usb_get_intfdata(interface);
+	struct trigger6_device *trigger6 = usb_get_intfdata(interface);
 
-	return drm_mode_config_helper_suspend(dev);
+	drm_kms_helper_poll_disable(&trigger6->drm);
+	cancel_work_sync(&trigger6->autotune_work);
+
+	/*
+	 * Frames committed from now on are only staged. Payloads hold
+	 * transfer_lock until their last URB has completed, and any sent
+	 * after this point fail with -EBUSY.
+	 */
+	mutex_lock(&trigger6->frame_lock);
+	mutex_lock(&trigger6->transfer_lock);
+	trigger6->suspended = true;
+	mutex_unlock(&trigger6->transfer_lock);
+	mutex_unlock(&trigger6->frame_lock);
+
+	return 0;
 }
 
 static int trigger6_usb_resume(struct usb_interface *interface)
 {
-	struct drm_device *dev = usb_get_intfdata(interface);
+	struct trigger6_device *trigger6 = usb_get_intfdata(interface);
+	bool changed;
+	int ret = 0;
+
+	changed = trigger6_connector_edid_changed(trigger6);
+
+	mutex_lock(&trigger6->frame_lock);
+	mutex_lock(&trigger6->transfer_lock);
+	trigger6->suspended = false;
+	mutex_unlock(&trigger6->transfer_lock);
+	if (trigger6->output_enabled && trigger6->current_mode) {
+		trigger6_enable_output(trigger6);
+		ret = trigger6_set_resolution(trigger6, trigger6->current_mode);
+		if (ret >= 0)
+			ret = trigger6_send_frame(trigger6);
+	}
+	mutex_unlock(&trigger6->frame_lock);
+
+	drm_kms_helper_poll_enable(&trigger6->drm);
+
+	if (changed)
+		drm_kms_helper_hotplug_event(&trigger6->drm);
+
+	return ret < 0 ? ret : 0;
+}
+
+static int trigger6_usb_reset_resume(struct usb_interface *interface)
+{
+	struct trigger6_device *trigger6 = usb_get_intfdata(interface);
+	int ret;
+
+	/* get_modes reads the EDID again under the same lock */
+	mutex_lock(&trigger6->drm.mode_config.mutex);
+	drm_edid_free(trigger6->edid);
+	trigger6->edid = NULL;
+	mutex_unlock(&trigger6->drm.mode_config.mutex);
+
+	ret = trigger6_usb_resume(interface);
+
+	drm_kms_helper_hotplug_event(&trigger6->drm);
 
-	return drm_mode_config_helper_resume(dev);
+	return ret;
 }
 
 /*
@@ -54,6 +123,12 @@ trigger6_driver_gem_prime_import(struct drm_device *dev,
 	return drm_gem_prime_import_dev(dev, dma_buf, trigger6->dmadev);
 }
 
+static const struct drm_ioctl_desc trigger6_ioctls[] = {
+	/* Replaces what is scanned out, so it is a master-only operation */
+	DRM_IOCTL_DEF_DRV(TRIGGER6_SUBMIT_FRAME, trigger6_submit_frame_ioctl,
+			  DRM_MASTER),
+};
+
 DEFINE_DRM_GEM_FOPS(trigger6_driver_fops);
 
 static const struct drm_driver driver = {
@@ -64,6 +139,11 @@ static const struct drm_driver driver = {
 	DRM_GEM_SHMEM_DRIVER_OPS,
 	.gem_prime_import = trigger6_driver_gem_prime_import,
 
+	.ioctls = trigger6_ioctls,
+	.num_ioctls = ARRAY_SIZE(trigger6_ioctls),
+
+	.debugfs_init = trigger6_debugfs_init,
+
 	.name = DRIVER_NAME,
 	.desc = DRIVER_DESC,
 	.date = DRIVER_DATE,
@@ -104,21 +184,39 @@ static void trigger6_pipe_enable(struct drm_simple_display_pipe *pipe,
 				 struct drm_plane_state *plane_state)
 {
 	struct trigger6_device *trigger6 = to_trigger6(pipe->crtc.dev);
+	struct trigger6_mode *mode;
 
+	mutex_lock(&trigger6->frame_lock);
 	trigger6_enable_output(trigger6);
+	trigger6_set_output_state(trigger6, true, trigger6->disconnected);
 
 	if (crtc_state->mode_changed) {
-		trigger6_set_resolution(
-			trigger6,
-			trigger6_get_mode(pipe, &crtc_state->adjusted_mode));
+		mode = trigger6_get_mode(pipe, &crtc_state->adjusted_mode);
+		if (!IS_ERR(mode)) {
+			trigger6_set_resolution(trigger6, mode);
+			trigger6->current_mode = mode;
+		}
 	}
+
+	/* The plane update ran before the output was on, show its frame */
+	trigger6_send_frame(trigger6);
+	mutex_unlock(&trigger6->frame_lock);
+
+	/* Probing sends many frames, keep it out of the commit */
+	if (crtc_state->mode_changed && READ_ONCE(trigger6->autotune))
+		schedule_work(&trigger6->autotune_work);
 }
 
 static void trigger6_pipe_disable(struct drm_simple_display_pipe *pipe)
 {
 	struct trigger6_device *device = to_trigger6(pipe->crtc.dev);
 
+	cancel_work_sync(&device->autotune_work);
+
+	mutex_lock(&device->frame_lock);
 	trigger6_disable_output(device);
+	trigger6_set_output_state(device, false, device->disconnected);
+	mutex_unlock(&device->frame_lock);
 }
 
 enum drm_mode_status
@@ -130,122 +228,411 @@ trigger6_pipe_mode_valid(struct drm_simple_display_pipe *pipe,
 	return IS_ERR(trigger6_mode) ? MODE_BAD : MODE_OK;
 }
 
+static int trigger6_pipe_check(struct drm_simple_display_pipe *pipe,
+			       struct drm_plane_state *plane_state,
+			       struct drm_crtc_state *crtc_state)
+{
+	const struct drm_framebuffer *fb = plane_state->fb;
+
+	/* NV12 is streamed as whole 2x2 chroma blocks */
+	if (fb && fb->format->format == DRM_FORMAT_NV12 &&
+	    (fb->width | fb->height) & 1)
+		return -EINVAL;
+
+	/* NV12 is passed through untouched, so it can't be rotated */
+	if (fb && fb->format->format == DRM_FORMAT_NV12 &&
+	    plane_state->rotation != DRM_MODE_ROTATE_0)
+		return -EINVAL;
+
+	/* Rotation reads the fb directly, which imports may map as I/O memory */
+	if (fb && fb->obj[0]->import_attach &&
+	    plane_state->rotation != DRM_MODE_ROTATE_0)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Pack the Y plane and the interleaved UV plane back to back */
+static void trigger6_nv12_pack(void *dst, const struct iosys_map *src,
+			       const struct drm_framebuffer *fb)
+{
+	unsigned int i, width = fb->width, height = fb->height;
+
+	for (i = 0; i < height; i++, dst += width)
+		iosys_map_memcpy_from(dst, &src[0], i * fb->pitches[0], width);
+	for (i = 0; i < height / 2; i++, dst += width)
+		iosys_map_memcpy_from(dst, &src[1], i * fb->pitches[1], width);
+}
+
+/* Caller holds frame_lock */
+static void *trigger6_frame_reserve(struct trigger6_device *trigger6,
+				    size_t size)
+{
+	if (size > trigger6->frame_buffer_size) {
+		vfree(trigger6->frame_buffer);
+		trigger6->frame_buffer_size = 0;
+		trigger6->frame_length = 0;
+		trigger6->frame_buffer = vmalloc(size);
+		if (!trigger6->frame_buffer)
+			return NULL;
+		trigger6->frame_buffer_size = size;
+	}
+
+	return trigger6->frame_buffer;
+}
+
+static void trigger6_free_frame_buffers(struct trigger6_device *trigger6)
+{
+	vfree(trigger6->frame_buffer);
+	trigger6->frame_buffer = NULL;
+	trigger6->frame_buffer_size = 0;
+	trigger6->frame_length = 0;
+	vfree(trigger6->partial_buffer);
+	trigger6->partial_buffer = NULL;
+	trigger6->partial_buffer_size = 0;
+}
+
+static void trigger6_frame_release(struct drm_device *dev, void *unused)
+{
+	trigger6_free_frame_buffers(to_trigger6(dev));
+}
+
+/*
+ * Update the output state under both locks, so that sends can check it
+ * with only transfer_lock held. The staging buffers and the URB pool are
+ * given back while nothing is shown; the next frame allocates them again
+ * and is sent in full. Caller holds frame_lock.
+ */
+void trigger6_set_output_state(struct trigger6_device *trigger6, bool enabled,
+			       bool disconnected)
+{
+	mutex_lock(&trigger6->transfer_lock);
+	trigger6->output_enabled = enabled;
+	trigger6->disconnected = disconnected;
+	if (!enabled || disconnected) {
+		trigger6_free_frame_buffers(trigger6);
+		trigger6_free_urb(trigger6);
+	}
+	mutex_unlock(&trigger6->transfer_lock);
+}
+
+static int trigger6_stream_frame(struct trigger6_device *trigger6,
+				 trigger6_fill_fn fill, void *data)
+{
+	struct kvec vec[2];
+	int ret;
+
+	vec[0].iov_base = &trigger6->frame_header;
+	vec[0].iov_len = sizeof(trigger6->frame_header);
+	vec[1].iov_base = trigger6->frame_buffer;
+	vec[1].iov_len = trigger6->frame_length;
+
+	/* The device may be left showing anything, resync on the next update */
+	ret = trigger6_stream_payload(trigger6, vec, ARRAY_SIZE(vec), fill,
+				      data);
+	if (ret < 0)
+		trigger6->frame_length = 0;
+
+	return ret;
+}
+
+/* Send the staged frame, caller holds frame_lock */
+int trigger6_send_frame(struct trigger6_device *trigger6)
+{
+	if (!trigger6->frame_length)
+		return 0;
+
+	return trigger6_stream_frame(trigger6, NULL, NULL);
+}
+
+/* Converts an unrotated XRGB8888 frame to staging as it is sent */
+struct trigger6_frame_fill {
+	const struct iosys_map *src;
+	const struct drm_framebuffer *fb;
+	struct drm_format_conv_state *fmtcnv_state;
+	void *dst;
+	unsigned int pitch;
+	int width;
+	int height;
+	int lines;
+};
+
+static void trigger6_frame_fill(void *data, size_t offset, size_t length)
+{
+	struct trigger6_frame_fill *fill = data;
+	unsigned int dst_pitch[DRM_FORMAT_MAX_PLANES] = { fill->pitch };
+	size_t end = offset + length;
+	struct iosys_map map;
+	struct drm_rect rect;
+	int lines;
+
+	/* The payload starts with the video header, which is already set */
+	if (end <= sizeof(struct trigger6_video_header))
+		return;
+
+	lines = min_t(size_t,
+		      DIV_ROUND_UP(end - sizeof(struct trigger6_video_header),
+				   fill->pitch),
+		      fill->height);
+	if (lines <= fill->lines)
+		return;
+
+	drm_rect_init(&rect, 0, fill->lines, fill->width, lines - fill->lines);
+	iosys_map_set_vaddr(&map, fill->dst + fill->lines * fill->pitch);
+	drm_fb_xrgb8888_to_rgb888(&map, dst_pitch, fill->src, fill->fb, &rect,
+				  fill->fmtcnv_state);
+	fill->lines = lines;
+}
+
+static u64 trigger6_rect_cost(const struct drm_rect *rect)
+{
+	return (u64)drm_rect_width(rect) * drm_rect_height(rect) * 3 +
+	       TRIGGER6_RECT_OVERHEAD;
+}
+
+static void trigger6_rect_union(struct drm_rect *dst, const struct drm_rect *a,
+				const struct drm_rect *b)
+{
+	dst->x1 = min(a->x1, b->x1);
+	dst->y1 = min(a->y1, b->y1);
+	dst->x2 = max(a->x2, b->x2);
+	dst->y2 = max(a->y2, b->y2);
+}
+
+/* Bytes saved on the wire by sending a and b as one rect, may be negative */
+static s64 trigger6_merge_gain(const struct drm_rect *a,
+			       const struct drm_rect *b)
+{
+	struct drm_rect merged;
+
+	trigger6_rect_union(&merged, a, b);
+	return (s64)(trigger6_rect_cost(a) + trigger6_rect_cost(b)) -
+	       (s64)trigger6_rect_cost(&merged);
+}
+
+/*
+ * Gather the individual damage clips and merge them while that does not
+ * make the upload larger. Returns the number of rects left.
+ */
+static int trigger6_collect_damage(struct drm_plane_state *old_state,
+				   struct drm_plane_state *state,
+				   struct drm_rect *rects)
+{
+	struct drm_atomic_helper_damage_iter iter;
+	struct drm_rect clip;
+	s64 gain, best_gain;
+	int i, j, n = 0, best_i, best_j;
+
+	drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+	drm_atomic_for_each_plane_damage(&iter, &clip) {
+		if (n < TRIGGER6_MAX_RECTS) {
+			rects[n++] = clip;
+			continue;
+		}
+
+		/* Out of slots, fold into the rect it costs least to grow */
+		best_i = 0;
+		best_gain = trigger6_merge_gain(&rects[0], &clip);
+		for (i = 1; i < n; i++) {
+			gain = trigger6_merge_gain(&rects[i], &clip);
+			if (gain > best_gain) {
+				best_gain = gain;
+				best_i = i;
+			}
+		}
+		trigger6_rect_union(&rects[best_i], &rects[best_i], &clip);
+	}
+
+	for (;;) {
+		best_i = -1;
+		best_j = -1;
+		best_gain = 0;
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; j < n; j++) {
+				gain = trigger6_merge_gain(&rects[i], &rects[j]);
+				if (gain >= best_gain) {
+					best_gain = gain;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+		if (best_i < 0)
+			break;
+
+		trigger6_rect_union(&rects[best_i], &rects[best_i],
+				    &rects[best_j]);
+		rects[best_j] = rects[--n];
+	}
+
+	return n;
+}
+
 static void trigger6_pipe_update(struct drm_simple_display_pipe *pipe,
 				 struct drm_plane_state *old_state)
 {
-	int ret;
+	int ret, i, nr_rects = 0;
 	struct trigger6_device *trigger6 = to_trigger6(pipe->crtc.dev);
-	struct usb_interface *intf = trigger6->intf;
-	struct usb_device *usb_dev = interface_to_usbdev(intf);
 	struct drm_plane_state *state = pipe->plane.state;
 	struct drm_shadow_plane_state *shadow_plane_state =
 		to_drm_shadow_plane_state(state);
+	struct drm_framebuffer *fb = state->fb;
+	struct drm_format_conv_state fmtcnv_state = DRM_FORMAT_CONV_STATE_INIT;
+	struct trigger6_video_header video_header;
+	struct drm_rect rects[TRIGGER6_MAX_RECTS];
+	struct drm_rect current_rect;
+	struct trigger6_frame_fill fill;
+	struct iosys_map map;
+	unsigned int dst_pitch[DRM_FORMAT_MAX_PLANES] = { 0 };
 	int width, height;
+	u32 format;
 	size_t buf_size;
-	struct drm_rect current_rect;
+	u64 rects_cost = 0;
+	unsigned int rotation;
+	bool full_frame, stream;
+	void *buf;
+
+	if (!drm_atomic_helper_damage_merged(old_state, state, &current_rect))
+		return;
+
+	rotation = state->rotation;
+	if (rotation != DRM_MODE_ROTATE_0) {
+		/* The device frame is the rotated plane, sized like the CRTC */
+		width = drm_rect_width(&state->dst);
+		height = drm_rect_height(&state->dst);
+	} else {
+		width = fb->width;
+		height = fb->height;
+	}
 
-	if (drm_atomic_helper_damage_merged(old_state, state, &current_rect)) {
-		// hack to force full screen updates for now
-		current_rect.x1 = 0;
-		current_rect.y1 = 0;
-		current_rect.x2 = state->fb->width;
-		current_rect.y2 = state->fb->height;
-
-		width = drm_rect_width(&current_rect);
-		height = drm_rect_height(&current_rect);
-
-		buf_size = sizeof(struct trigger6_video_header) +
-			   width * height * 3;
-		void *buf = vmalloc(buf_size);
-		struct trigger6_video_header video_header = { 0 };
-		video_header.type = cpu_to_le32(0x3);
-		video_header.data_length = cpu_to_le32(buf_size);
-		video_header.sequence_counter = cpu_to_le32(1);
-		video_header.unk4 = cpu_to_le32(0x9);
-		// Guessed from pcap
-		video_header.width = cpu_to_le16(width * 3);
-		video_header.height = cpu_to_le16(0);
-		video_header.start_address = cpu_to_le32(0x60);
-		video_header.end_address = cpu_to_le32(0x60);
-		video_header.image_format = cpu_to_le32(TRIGGER6_BGR24_FORMAT);
-		memcpy(buf, &video_header, sizeof(video_header));
-
-		// Put BGR24 representation of framebuffer into buf
-		struct iosys_map map = IOSYS_MAP_INIT_VADDR(
-			buf + sizeof(struct trigger6_video_header));
-		ret = drm_gem_fb_begin_cpu_access(state->fb, DMA_FROM_DEVICE);
-		if (ret < 0) {
-			drm_warn(&trigger6->drm, "fb CPU access failed: %d",
-				 ret);
-		}
-		struct drm_format_conv_state fmtcnv_state =
-			DRM_FORMAT_CONV_STATE_INIT;
-		drm_fb_xrgb8888_to_rgb888(&map, NULL,
-					  &shadow_plane_state->data[0],
-					  state->fb, &current_rect,
-					  &fmtcnv_state);
-		drm_gem_fb_end_cpu_access(state->fb, DMA_FROM_DEVICE);
-
-		size_t blocks =
-			DIV_ROUND_UP(buf_size, TRIGGER6_MAX_TRANSFER_LENGTH);
-		struct trigger6_session *session =
-			kzalloc(sizeof(struct trigger6_session), GFP_KERNEL);
-		void *transfer_block =
-			kmalloc(TRIGGER6_MAX_TRANSFER_LENGTH, GFP_KERNEL);
-
-		for (size_t i = 0; i < blocks; i++) {
-			size_t offset = i * TRIGGER6_MAX_TRANSFER_LENGTH;
-			size_t length =
-				min((i + 1) * TRIGGER6_MAX_TRANSFER_LENGTH,
-				    buf_size) -
-				offset;
-			session->session_number = 0;
-			session->payload_length = cpu_to_le32(buf_size);
-			session->dest_addr = cpu_to_le32(0x030);
-			session->fragment_length = cpu_to_le32(length);
-			session->output_index = cpu_to_le32(0x0);
-			session->offset = cpu_to_le32(offset);
-
-			ret = usb_bulk_msg(
-				usb_dev,
-				usb_sndbulkpipe(usb_dev,
-						TRIGGER6_ENDPOINT_BULK_OUT),
-				session, sizeof(struct trigger6_session), NULL,
-				5000);
-			if (ret < 0) {
-				drm_warn(&trigger6->drm,
-					 "Session negotiation failed: %d", ret);
-			}
+	if (fb->format->format == DRM_FORMAT_NV12) {
+		format = TRIGGER6_NV12_FORMAT;
+		buf_size = width * height * 3 / 2;
+	} else {
+		format = TRIGGER6_BGR24_FORMAT;
+		buf_size = width * height * 3;
+	}
+	trigger6_init_video_header(&video_header, format, width, height,
+				   buf_size);
+
+	mutex_lock(&trigger6->frame_lock);
+	/* Nothing to show it on, don't hold memory for it */
+	if (trigger6->disconnected)
+		goto unlock;
+
+	/* Check rejects imported fbs, send nothing rather than a stale frame */
+	if (rotation != DRM_MODE_ROTATE_0 &&
+	    shadow_plane_state->data[0].is_iomem) {
+		drm_warn_once(&trigger6->drm,
+			      "rotation needs a system memory fb\n");
+		trigger6->frame_length = 0;
+		goto unlock;
+	}
 
-			memcpy(transfer_block, buf + offset, length);
-			ret = usb_bulk_msg(
-				usb_dev,
-				usb_sndbulkpipe(usb_dev,
-						TRIGGER6_ENDPOINT_BULK_OUT),
-				transfer_block, length, NULL, 5000);
+	buf = trigger6_frame_reserve(trigger6, buf_size);
+	if (!buf)
+		goto unlock;
+
+	/*
+	 * The staging buffer mirrors the device frame. Partial updates patch
+	 * it and send only the damaged rects, anything else refreshes it all.
+	 */
+	full_frame = !partial_updates || format != TRIGGER6_BGR24_FORMAT ||
+		     rotation != DRM_MODE_ROTATE_0 ||
+		     trigger6->frame_rotation != rotation ||
+		     trigger6->frame_length != buf_size ||
+		     memcmp(&trigger6->frame_header, &video_header,
+			    sizeof(video_header));
+	if (!full_frame) {
+		nr_rects = trigger6_collect_damage(old_state, state, rects);
+		for (i = 0; i < nr_rects; i++)
+			rects_cost += trigger6_rect_cost(&rects[i]);
+		full_frame = rects_cost >= buf_size;
+	}
+	if (full_frame) {
+		drm_rect_init(&rects[0], 0, 0, width, height);
+		nr_rects = 1;
+	}
 
-			if (ret < 0) {
-				drm_warn(&trigger6->drm,
-					 "Transfer block failed");
-			}
+	/*
+	 * A full frame that goes out right away is converted one fragment
+	 * at a time as it is sent, so copying it into the URBs reads cache
+	 * instead of a staging buffer larger than the LLC.
+	 */
+	stream = full_frame && format == TRIGGER6_BGR24_FORMAT &&
+		 rotation == DRM_MODE_ROTATE_0 && !trigger6->suspended &&
+		 trigger6->output_enabled;
+
+	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
+	if (ret < 0) {
+		drm_warn(&trigger6->drm, "fb CPU access failed: %d", ret);
+	}
+	if (format == TRIGGER6_NV12_FORMAT) {
+		// NV12 goes to the device as-is
+		trigger6_nv12_pack(buf, shadow_plane_state->data, fb);
+	} else if (rotation != DRM_MODE_ROTATE_0) {
+		// Rotate and convert the visible source in cache-sized tiles
+		trigger6_xrgb8888_to_bgr24_blocked(
+			buf, width, height,
+			shadow_plane_state->data[0].vaddr +
+				(state->src.y1 >> 16) * fb->pitches[0] +
+				(state->src.x1 >> 16) * 4,
+			fb->pitches[0], rotation);
+	} else if (!stream) {
+		// Put BGR24 representation of the damage into buf
+		dst_pitch[0] = width * 3;
+		for (i = 0; i < nr_rects; i++) {
+			iosys_map_set_vaddr(&map, buf);
+			iosys_map_incr(&map, rects[i].y1 * dst_pitch[0] +
+					     rects[i].x1 * 3);
+			drm_fb_xrgb8888_to_rgb888(&map, dst_pitch,
+						  &shadow_plane_state->data[0],
+						  fb, &rects[i], &fmtcnv_state);
 		}
+	}
 
-		kfree(session);
-		kfree(transfer_block);
-		vfree(buf);
+	trigger6->frame_header = video_header;
+	trigger6->frame_length = buf_size;
+	trigger6->frame_rotation = rotation;
+
+	if (stream) {
+		fill = (struct trigger6_frame_fill) {
+			.src = &shadow_plane_state->data[0],
+			.fb = fb,
+			.fmtcnv_state = &fmtcnv_state,
+			.dst = buf,
+			.pitch = width * 3,
+			.width = width,
+			.height = height,
+		};
+		trigger6_stream_frame(trigger6, trigger6_frame_fill, &fill);
 	}
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+	drm_format_conv_state_release(&fmtcnv_state);
+
+	// Resume and pipe enable send whatever was staged last
+	if (stream || trigger6->suspended || !trigger6->output_enabled)
+		goto unlock;
+	if (full_frame)
+		trigger6_send_frame(trigger6);
+	else
+		trigger6_send_rects(trigger6, width, rects, nr_rects);
+unlock:
+	mutex_unlock(&trigger6->frame_lock);
 }
 
 static const struct drm_simple_display_pipe_funcs trigger6_pipe_funcs = {
 	.enable = trigger6_pipe_enable,
 	.disable = trigger6_pipe_disable,
 	.mode_valid = trigger6_pipe_mode_valid,
+	.check = trigger6_pipe_check,
 	.update = trigger6_pipe_update,
 	DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
 };
 
 static const uint32_t trigger6_pipe_formats[] = {
 	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_NV12,
 };
 
 static int trigger6_usb_probe(struct usb_interface *interface,
@@ -264,6 +651,23 @@ static int trigger6_usb_probe(struct usb_interface *interface,
 	dev = &trigger6->drm;
 
 	init_completion(&trigger6->transfer_done);
+	trigger6_transfer_init(trigger6);
+
+	ret = drmm_mutex_init(dev, &trigger6->transfer_lock);
+	if (ret)
+		return ret;
+
+	ret = drmm_mutex_init(dev, &trigger6->frame_lock);
+	if (ret)
+		return ret;
+
+	ret = drmm_add_action_or_reset(dev, trigger6_frame_release, NULL);
+	if (ret)
+		return ret;
+
+	ret = trigger6_capture_init(trigger6);
+	if (ret)
+		return ret;
 
 	trigger6->dmadev = usb_intf_get_dma_device(interface);
 	if (!trigger6->dmadev)
@@ -281,8 +685,6 @@ static int trigger6_usb_probe(struct usb_interface *interface,
 	dev->mode_config.max_height = 10000;
 	dev->mode_config.funcs = &trigger6_mode_config_funcs;
 
-	// Might need
-	// trigger6_init_urb(trigger6, 100 * TRIGGER6_MAX_TRANSFER_LENGTH);
 	trigger6_read_modes(trigger6, 0, 0, trigger6->modes, 512);
 	trigger6_read_modes(trigger6, 0, 512, trigger6->modes + 16, 448);
 
@@ -306,6 +708,14 @@ static int trigger6_usb_probe(struct usb_interface *interface,
 
 	drm_plane_enable_fb_damage_clips(&trigger6->display_pipe.plane);
 
+	ret = drm_plane_create_rotation_property(
+		&trigger6->display_pipe.plane, DRM_MODE_ROTATE_0,
+		DRM_MODE_ROTATE_0 | DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_180 |
+			DRM_MODE_ROTATE_270 | DRM_MODE_REFLECT_X |
+			DRM_MODE_REFLECT_Y);
+	if (ret)
+		goto err_put_device;
+
 	drm_mode_config_reset(dev);
 
 	usb_set_intfdata(interface, trigger6);
@@ -333,6 +743,12 @@ static void trigger6_usb_disconnect(struct usb_interface *interface)
 	drm_kms_helper_poll_fini(dev);
 	drm_dev_unplug(dev);
 	drm_atomic_helper_shutdown(dev);
+	cancel_work_sync(&trigger6->autotune_work);
+
+	mutex_lock(&trigger6->transfer_lock);
+	trigger6_free_urb(trigger6);
+	mutex_unlock(&trigger6->transfer_lock);
+
 	put_device(trigger6->dmadev);
 	trigger6->dmadev = NULL;
 }
@@ -349,6 +765,7 @@ static struct usb_driver trigger6_driver = {
 	.disconnect = trigger6_usb_disconnect,
 	.suspend = trigger6_usb_suspend,
 	.resume = trigger6_usb_resume,
+	.reset_resume = trigger6_usb_reset_resume,
 	.id_table = id_table,
 };
 
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/dma-buf.h>
+#include <linux/iosys-map.h>
+
+#include <drm/drm_drv.h>
+#include <drm/drm_file.h>
+#include <drm/drm_gem.h>
+#include <drm/drm_print.h>
+
+#include "trigger6.h"
+#include "trigger6_drm.h"
+
+static int trigger6_check_frame(struct drm_device *dev,
+				const struct drm_trigger6_submit_frame *args)
+{
+	if (args->format != DRM_TRIGGER6_FORMAT_JPEG &&
+	    args->format != DRM_TRIGGER6_FORMAT_NV12)
+		return -EINVAL;
+
+	if (!args->width || args->width > dev->mode_config.max_width ||
+	    !args->height || args->height > dev->mode_config.max_height ||
+	    !args->size)
+		return -EINVAL;
+
+	/* NV12 has a full-size Y plane followed by a half-size UV plane */
+	if (args->format == DRM_TRIGGER6_FORMAT_NV12 &&
+	    ((args->width | args->height) & 1 ||
+	     args->size < args->width * args->height * 3 / 2))
+		return -EINVAL;
+
+	return 0;
+}
+
+int trigger6_submit_frame_ioctl(struct drm_device *dev, void *data,
+				struct drm_file *file)
+{
+	struct trigger6_device *trigger6 = to_trigger6(dev);
+	struct drm_trigger6_submit_frame *args = data;
+	struct trigger6_video_header video_header;
+	struct trigger6_mode *mode;
+	struct drm_gem_object *obj;
+	struct iosys_map map;
+	struct kvec vec[2];
+	int ret, idx;
+
+	ret = trigger6_check_frame(dev, args);
+	if (ret)
+		return ret;
+
+	obj = drm_gem_object_lookup(file, args->handle);
+	if (!obj)
+		return -ENOENT;
+
+	if (args->offset > obj->size || args->size > obj->size - args->offset) {
+		ret = -EINVAL;
+		goto put_object;
+	}
+
+	if (!drm_dev_enter(dev, &idx)) {
+		ret = -ENODEV;
+		goto put_object;
+	}
+
+	ret = drm_gem_vmap_unlocked(obj, &map);
+	if (ret)
+		goto dev_exit;
+
+	/* The payload is copied straight into the transfer blocks */
+	if (map.is_iomem) {
+		ret = -EOPNOTSUPP;
+		goto vunmap;
+	}
+
+	if (obj->import_attach) {
+		ret = dma_buf_begin_cpu_access(obj->import_attach->dmabuf,
+					       DMA_FROM_DEVICE);
+		if (ret)
+			goto vunmap;
+	}
+
+	/* The frame has to match what the device is programmed for */
+	mutex_lock(&trigger6->frame_lock);
+	mode = trigger6->current_mode;
+	if (!mode || mode->line_active_pixels != args->width ||
+	    mode->frame_active_lines != args->height) {
+		ret = -EINVAL;
+	} else {
+		trigger6_init_video_header(&video_header, args->format,
+					   args->width, args->height,
+					   args->size);
+		vec[0].iov_base = &video_header;
+		vec[0].iov_len = sizeof(video_header);
+		vec[1].iov_base = map.vaddr + args->offset;
+		vec[1].iov_len = args->size;
+		ret = trigger6_send_payload(trigger6, vec, ARRAY_SIZE(vec));
+		/* The device no longer shows the staged frame */
+		trigger6->frame_length = 0;
+	}
+	mutex_unlock(&trigger6->frame_lock);
+
+	if (obj->import_attach)
+		dma_buf_end_cpu_access(obj->import_attach->dmabuf,
+				       DMA_FROM_DEVICE);
+vunmap:
+	drm_gem_vunmap_unlocked(obj, &map);
+dev_exit:
+	drm_dev_exit(idx);
+put_object:
+	drm_gem_object_put(obj);
+	return ret;
+}
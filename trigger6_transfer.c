@@ -1,10 +1,30 @@
 
 #include <linux/dma-buf.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/sizes.h>
+#include <linux/uio.h>
+#include <linux/vmalloc.h>
 
 #include <drm/drm_drv.h>
 #include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_print.h>
 
 #include "trigger6.h"
+#include "trigger6_drm.h"
+
+static unsigned int fragment_length = TRIGGER6_DEFAULT_TRANSFER_LENGTH;
+module_param(fragment_length, uint, 0644);
+MODULE_PARM_DESC(fragment_length, "Bytes per bulk fragment");
+
+static unsigned int urb_depth = TRIGGER6_DEFAULT_URB_DEPTH;
+module_param(urb_depth, uint, 0644);
+MODULE_PARM_DESC(urb_depth, "Fragments in flight at once");
+
+static bool autotune;
+module_param(autotune, bool, 0644);
+MODULE_PARM_DESC(autotune, "Pick fragment length and depth at mode set");
 
 void trigger6_free_urb(struct trigger6_device *trigger6)
 {
@@ -21,66 +41,132 @@ void trigger6_free_urb(struct trigger6_device *trigger6)
 		list_del(&urb_entry->entry);
 		spin_unlock_irq(&trigger6->urb_available_list_lock);
 
-		usb_free_coherent(usb_dev, TRIGGER6_MAX_TRANSFER_LENGTH,
+		usb_free_coherent(usb_dev, sizeof(struct trigger6_session),
+				  urb_entry->session_urb->transfer_buffer,
+				  urb_entry->session_urb->transfer_dma);
+		usb_free_urb(urb_entry->session_urb);
+		usb_free_coherent(usb_dev, trigger6->urb_length,
 				  urb_entry->urb->transfer_buffer,
 				  urb_entry->urb->transfer_dma);
 		usb_free_urb(urb_entry->urb);
 		kfree(urb_entry);
 	}
+	trigger6->num_urbs = 0;
+	trigger6->urb_length = 0;
+	trigger6->urb_pool_depth = 0;
+}
+
+static void trigger6_note_status(struct trigger6_device *trigger6,
+				 struct urb *urb)
+{
+	switch (urb->status) {
+	case 0:
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		break;
+	default:
+		WRITE_ONCE(trigger6->transfer_status, urb->status);
+		break;
+	}
 }
 
-void trigger6_urb_completion(struct urb *urb)
+static void trigger6_session_completion(struct urb *urb)
+{
+	struct trigger6_urb *urb_entry = urb->context;
+
+	trigger6_note_status(urb_entry->parent, urb);
+}
+
+static void trigger6_urb_completion(struct urb *urb)
 {
 	struct trigger6_urb *urb_entry = urb->context;
 	struct trigger6_device *trigger6 = urb_entry->parent;
 	unsigned long flags;
 
+	trigger6_note_status(trigger6, urb);
+
 	spin_lock_irqsave(&trigger6->urb_available_list_lock, flags);
 	list_add_tail(&urb_entry->entry, &trigger6->urb_available_list);
 	spin_unlock_irqrestore(&trigger6->urb_available_list_lock, flags);
 	up(&trigger6->urb_available_list_sem);
 }
 
-int trigger6_init_urb(struct trigger6_device *trigger6, size_t total_size)
+static struct urb *trigger6_alloc_bulk_urb(struct usb_device *usb_dev,
+					   size_t length,
+					   usb_complete_t complete,
+					   void *context)
 {
-	int i, blocks;
-	struct trigger6_urb *urb_entry;
 	struct urb *urb;
 	void *urb_buf;
+
+	urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!urb)
+		return NULL;
+
+	urb_buf = usb_alloc_coherent(usb_dev, length, GFP_KERNEL,
+				     &urb->transfer_dma);
+	if (!urb_buf) {
+		usb_free_urb(urb);
+		return NULL;
+	}
+
+	usb_fill_bulk_urb(urb, usb_dev,
+			  usb_sndbulkpipe(usb_dev, TRIGGER6_ENDPOINT_BULK_OUT),
+			  urb_buf, length, complete, context);
+	urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+	return urb;
+}
+
+static void trigger6_free_bulk_urb(struct usb_device *usb_dev,
+				   struct urb *urb, size_t length)
+{
+	usb_free_coherent(usb_dev, length, urb->transfer_buffer,
+			  urb->transfer_dma);
+	usb_free_urb(urb);
+}
+
+/*
+ * Allocate a pool of depth entries, each pairing a session header URB with
+ * a fragment URB of length bytes. Returns the number of entries allocated.
+ */
+int trigger6_init_urb(struct trigger6_device *trigger6, int depth,
+		      size_t length)
+{
+	int i;
+	struct trigger6_urb *urb_entry;
 	struct usb_device *usb_dev = interface_to_usbdev(trigger6->intf);
 
-	blocks = DIV_ROUND_UP(total_size, TRIGGER6_MAX_TRANSFER_LENGTH);
 	spin_lock_init(&trigger6->urb_available_list_lock);
 	INIT_LIST_HEAD(&trigger6->urb_available_list);
 	sema_init(&trigger6->urb_available_list_sem, 0);
 	trigger6->num_urbs = 0;
-	for (i = 0; i < blocks; i++) {
+	trigger6->urb_length = length;
+	trigger6->urb_pool_depth = depth;
+	for (i = 0; i < depth; i++) {
 		urb_entry = kzalloc(sizeof(struct trigger6_urb), GFP_KERNEL);
 		if (!urb_entry)
 			break;
 		urb_entry->parent = trigger6;
 
-		urb = usb_alloc_urb(0, GFP_KERNEL);
-		if (!urb) {
+		urb_entry->session_urb = trigger6_alloc_bulk_urb(
+			usb_dev, sizeof(struct trigger6_session),
+			trigger6_session_completion, urb_entry);
+		if (!urb_entry->session_urb) {
 			kfree(urb_entry);
 			break;
 		}
-		urb_entry->urb = urb;
-
-		urb_buf =
-			usb_alloc_coherent(usb_dev, TRIGGER6_MAX_TRANSFER_LENGTH,
-					   GFP_KERNEL, &urb->transfer_dma);
 
-		if (!urb_buf) {
-			usb_free_urb(urb);
+		urb_entry->urb = trigger6_alloc_bulk_urb(
+			usb_dev, length, trigger6_urb_completion, urb_entry);
+		if (!urb_entry->urb) {
+			trigger6_free_bulk_urb(usb_dev, urb_entry->session_urb,
+					       sizeof(struct trigger6_session));
 			kfree(urb_entry);
 			break;
 		}
 
-		usb_fill_bulk_urb(urb, usb_dev, usb_sndbulkpipe(usb_dev, 4),
-				  urb_buf, TRIGGER6_MAX_TRANSFER_LENGTH,
-				  trigger6_urb_completion, urb_entry);
-		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
 		list_add_tail(&urb_entry->entry, &trigger6->urb_available_list);
 		up(&trigger6->urb_available_list_sem);
 		trigger6->num_urbs++;
@@ -88,14 +174,24 @@ int trigger6_init_urb(struct trigger6_device *trigger6, size_t total_size)
 	return trigger6->num_urbs;
 }
 
+/* Take a free pool entry, caller holds transfer_lock */
 struct urb *trigger6_get_urb(struct trigger6_device *trigger6)
 {
 	int ret;
 	struct trigger6_urb *urb_entry;
 
-	ret = down_interruptible(&trigger6->urb_available_list_sem);
-	if (ret < 0)
-		return ERR_PTR(ret);
+	/*
+	 * Bound the wait like the bulk transfers before it. Callers include
+	 * kernel threads, which no signal can get out of a device that stops
+	 * completing URBs.
+	 */
+	ret = down_timeout(&trigger6->urb_available_list_sem,
+			   msecs_to_jiffies(5000));
+	if (ret < 0) {
+		/* Completing the stuck URBs returns them to the pool */
+		usb_kill_anchored_urbs(&trigger6->urb_anchor);
+		return ERR_PTR(-ETIMEDOUT);
+	}
 
 	spin_lock_irq(&trigger6->urb_available_list_lock);
 	urb_entry = list_first_entry(&trigger6->urb_available_list,
@@ -106,89 +202,396 @@ struct urb *trigger6_get_urb(struct trigger6_device *trigger6)
 	return urb_entry->urb;
 }
 
-static const unsigned char trigger6_end_of_buffer[8] = { 0xff, 0xc0, 0x00, 0x00,
-						       0x00, 0x00, 0x00, 0x00 };
+/*
+ * Rebuild the pool when the tunables changed, with fragments of at least
+ * min_length bytes. Caller holds transfer_lock.
+ */
+static int trigger6_prepare_urbs(struct trigger6_device *trigger6,
+				 size_t min_length)
+{
+	u32 length = clamp_t(u32, max_t(size_t, min_length,
+					READ_ONCE(trigger6->fragment_length)),
+			     TRIGGER6_MIN_TRANSFER_LENGTH,
+			     TRIGGER6_MAX_TRANSFER_LENGTH);
+	u32 depth = clamp_t(u32, READ_ONCE(trigger6->urb_depth), 1,
+			    TRIGGER6_MAX_URB_DEPTH);
+
+	if (trigger6->num_urbs && trigger6->urb_length == length &&
+	    trigger6->urb_pool_depth == depth)
+		return 0;
+
+	trigger6_free_urb(trigger6);
+	if (!trigger6_init_urb(trigger6, depth, length))
+		return -ENOMEM;
+
+	return 0;
+}
+
+void trigger6_init_video_header(struct trigger6_video_header *header,
+				u32 format, u16 width, u16 height,
+				size_t data_length)
+{
+	memset(header, 0, sizeof(*header));
+	header->type = cpu_to_le32(0x3);
+	header->data_length = cpu_to_le32(sizeof(*header) + data_length);
+	header->sequence_counter = cpu_to_le32(1);
+	header->unk4 = cpu_to_le32(format);
+	// Guessed from pcap
+	if (format == TRIGGER6_BGR24_FORMAT) {
+		header->width = cpu_to_le16(width * 3);
+		header->height = cpu_to_le16(0);
+	} else {
+		header->width = cpu_to_le16(width);
+		header->height = cpu_to_le16(height);
+	}
+	header->start_address = cpu_to_le32(0x60);
+	header->end_address = cpu_to_le32(0x60);
+	header->image_format = cpu_to_le32(format);
+}
+
+/*
+ * Header for one rect of a partial update, guessed from pcap: the width is
+ * in bytes per line as for full frames, and the addresses are the byte
+ * offsets of the first and one-past-last pixel in the device frame.
+ */
+static void trigger6_init_rect_header(struct trigger6_video_header *header,
+				      int frame_width,
+				      const struct drm_rect *rect,
+				      size_t data_length)
+{
+	memset(header, 0, sizeof(*header));
+	header->type = cpu_to_le32(0x4);
+	header->data_length = cpu_to_le32(sizeof(*header) + data_length);
+	header->sequence_counter = cpu_to_le32(1);
+	header->unk4 = cpu_to_le32(TRIGGER6_BGR24_FORMAT);
+	header->width = cpu_to_le16(drm_rect_width(rect) * 3);
+	header->height = cpu_to_le16(drm_rect_height(rect));
+	header->start_address =
+		cpu_to_le32((rect->y1 * frame_width + rect->x1) * 3);
+	header->end_address =
+		cpu_to_le32(((rect->y2 - 1) * frame_width + rect->x2) * 3);
+	header->image_format = cpu_to_le32(TRIGGER6_BGR24_FORMAT);
+}
 
-void trigger6_fb_send_rect(struct drm_framebuffer *fb,
-			 const struct iosys_map *map, struct drm_rect *rect)
+/*
+ * Send the given rects of the staged BGR24 frame as one payload, with their
+ * headers packed back to back so small rects share fragments. Caller holds
+ * frame_lock.
+ */
+int trigger6_send_rects(struct trigger6_device *trigger6, int frame_width,
+			const struct drm_rect *rects, int nr_rects)
 {
-	int ret, i;
-	void *vaddr = map->vaddr;
-	struct trigger6_device *trigger6 = to_trigger6(fb->dev);
-	struct drm_device *drm = &trigger6->drm;
-	struct trigger6_frame_update_header header;
+	size_t pitch = frame_width * 3;
+	size_t size = 0, line, data_length;
+	struct kvec vec;
+	void *dst;
+	int i, y, ret;
+
+	for (i = 0; i < nr_rects; i++)
+		size += sizeof(struct trigger6_video_header) +
+			drm_rect_width(&rects[i]) * drm_rect_height(&rects[i]) *
+				3;
+
+	if (size > trigger6->partial_buffer_size) {
+		vfree(trigger6->partial_buffer);
+		trigger6->partial_buffer_size = 0;
+		trigger6->partial_buffer = vmalloc(size);
+		if (!trigger6->partial_buffer) {
+			ret = -ENOMEM;
+			goto invalidate;
+		}
+		trigger6->partial_buffer_size = size;
+	}
+
+	dst = trigger6->partial_buffer;
+	for (i = 0; i < nr_rects; i++) {
+		line = drm_rect_width(&rects[i]) * 3;
+		data_length = line * drm_rect_height(&rects[i]);
+		trigger6_init_rect_header(dst, frame_width, &rects[i],
+					  data_length);
+		dst += sizeof(struct trigger6_video_header);
+
+		for (y = rects[i].y1; y < rects[i].y2; y++, dst += line)
+			memcpy(dst,
+			       trigger6->frame_buffer + y * pitch +
+				       rects[i].x1 * 3,
+			       line);
+	}
+
+	vec.iov_base = trigger6->partial_buffer;
+	vec.iov_len = size;
+
+	ret = trigger6_send_payload(trigger6, &vec, 1);
+	if (ret >= 0)
+		return ret;
+
+invalidate:
+	/* The mirror was patched but the device wasn't, resync in full */
+	trigger6->frame_length = 0;
+	return ret;
+}
+
+/*
+ * Check that the output can take a stream and get the URB pool ready for
+ * fragments of up to min_length bytes. Caller holds transfer_lock.
+ */
+int trigger6_transfer_begin(struct trigger6_device *trigger6,
+			    size_t min_length)
+{
+	int ret;
+
+	/* Transfer memory only exists while the output is in use */
+	if (trigger6->suspended || !trigger6->output_enabled ||
+	    trigger6->disconnected)
+		return -EBUSY;
+
+	ret = trigger6_prepare_urbs(trigger6, min_length);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(trigger6->transfer_status, 0);
+	return 0;
+}
+
+/*
+ * Submit a pool entry whose session header and fragment have been filled
+ * in. On failure the entry goes back to the pool. Caller holds
+ * transfer_lock.
+ */
+int trigger6_submit_urb(struct trigger6_device *trigger6, struct urb *urb)
+{
+	struct trigger6_urb *urb_entry = urb->context;
+	int ret;
+
+	/* Both go to the same endpoint, so they complete in order */
+	usb_anchor_urb(urb_entry->session_urb, &trigger6->urb_anchor);
+	ret = usb_submit_urb(urb_entry->session_urb, GFP_KERNEL);
+	if (ret < 0) {
+		usb_unanchor_urb(urb_entry->session_urb);
+		trigger6_urb_completion(urb);
+		drm_warn(&trigger6->drm, "Session negotiation failed: %d", ret);
+		return ret;
+	}
+
+	usb_anchor_urb(urb, &trigger6->urb_anchor);
+	ret = usb_submit_urb(urb, GFP_KERNEL);
+	if (ret < 0) {
+		usb_unanchor_urb(urb);
+		usb_kill_urb(urb_entry->session_urb);
+		trigger6_urb_completion(urb);
+		drm_warn(&trigger6->drm, "Transfer block failed: %d", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for every submitted fragment to complete, returns the first error
+ * any of them reported. Caller holds transfer_lock.
+ */
+int trigger6_wait_urbs(struct trigger6_device *trigger6)
+{
+	if (!usb_wait_anchor_empty_timeout(&trigger6->urb_anchor, 5000)) {
+		usb_kill_anchored_urbs(&trigger6->urb_anchor);
+		return -ETIMEDOUT;
+	}
+
+	return READ_ONCE(trigger6->transfer_status);
+}
+
+/*
+ * Stream a payload made of several segments to the device. Every fragment
+ * is preceded by its own session header, and up to urb_depth fragments are
+ * in flight at once. If fill is set, it is called for each fragment before
+ * its bytes are copied out of vec. Returns once the whole payload has
+ * completed.
+ */
+int trigger6_stream_payload(struct trigger6_device *trigger6,
+			    const struct kvec *vec, unsigned int nr_segs,
+			    trigger6_fill_fn fill, void *data)
+{
+	struct trigger6_session *session;
+	struct trigger6_urb *urb_entry;
 	struct urb *urb;
-	void *transfer_buffer;
-	int total_length = 0;
-	int transfer_blocks, transfer_length;
-	/* Hardware can only update framebuffer in multiples of 16 horizontally */
-	int x = ALIGN_DOWN(rect->x1, 16);
-	int width = ALIGN(rect->x2, 16) - x;
-	int y1 = rect->y1;
-	int y2 = rect->y2;
-	int idx;
-
-	drm_dev_enter(drm, &idx);
-
-	rect->x1 = x;
-	rect->x2 = x + width;
-
-	header.header = cpu_to_be16(0xff00);
-	header.x = x / 16;
-	header.y = cpu_to_be16(y1);
-	header.width = width / 16;
-	header.height = cpu_to_be16(drm_rect_height(rect));
-
-	transfer_buffer =
-		vmalloc(drm_rect_width(rect) * drm_rect_height(rect) * 2 + 16);
-	if (!transfer_buffer)
-		goto dev_exit;
-
-	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
-	if (ret < 0)
-		goto free_transfer_buffer;
-
-	memcpy(transfer_buffer, &header, 8);
-	total_length += 8;
-
-	for (i = y1; i < y2; i++) {
-		const int line_offset = fb->pitches[0] * i;
-		const int byte_offset = line_offset + (x * 4);
-		trigger6_xrgb_to_yuv422_line(transfer_buffer + total_length,
-					   vaddr + byte_offset, width);
-		total_length += width * 2;
-	}
-
-	memcpy(transfer_buffer + total_length, trigger6_end_of_buffer, 8);
-	total_length += 8;
-
-	transfer_blocks =
-		DIV_ROUND_UP(total_length, TRIGGER6_MAX_TRANSFER_LENGTH);
-
-	for (i = 0; i < transfer_blocks; i++) {
-		/* Last block may be shorter */
+	size_t payload_length = 0, offset = 0, seg_offset = 0;
+	size_t length, filled, n;
+	unsigned int i, seg = 0;
+	ktime_t start;
+	int ret, err, idx;
+
+	for (i = 0; i < nr_segs; i++)
+		payload_length += vec[i].iov_len;
+
+	if (!drm_dev_enter(&trigger6->drm, &idx))
+		return -ENODEV;
+
+	mutex_lock(&trigger6->transfer_lock);
+	ret = trigger6_transfer_begin(trigger6, 0);
+	if (ret)
+		goto unlock;
+
+	trigger6_capture_frame(trigger6, payload_length, trigger6->urb_length);
+	start = ktime_get();
+	while (offset < payload_length) {
+		length = min_t(size_t, payload_length - offset,
+			       trigger6->urb_length);
+
 		urb = trigger6_get_urb(trigger6);
-		if (IS_ERR(urb))
-			break;
-		transfer_length = min((i + 1) * TRIGGER6_MAX_TRANSFER_LENGTH,
-				      total_length) -
-				  i * TRIGGER6_MAX_TRANSFER_LENGTH;
-
-		memcpy(urb->transfer_buffer,
-		       transfer_buffer + i * TRIGGER6_MAX_TRANSFER_LENGTH,
-		       transfer_length);
-		urb->transfer_buffer_length = transfer_length;
-		urb->complete = trigger6_urb_completion;
-		ret = usb_submit_urb(urb, GFP_KERNEL);
-		if (ret < 0) {
-			trigger6_urb_completion(urb);
+		if (IS_ERR(urb)) {
+			ret = PTR_ERR(urb);
 			break;
 		}
+		urb_entry = urb->context;
+
+		session = urb_entry->session_urb->transfer_buffer;
+		memset(session, 0, sizeof(struct trigger6_session));
+		session->session_number = 0;
+		session->payload_length = cpu_to_le32(payload_length);
+		session->dest_addr = cpu_to_le32(0x030);
+		session->fragment_length = cpu_to_le32(length);
+		session->output_index = cpu_to_le32(0x0);
+		session->offset = cpu_to_le32(offset);
+
+		if (fill)
+			fill(data, offset, length);
+		for (filled = 0; filled < length; filled += n) {
+			n = min(vec[seg].iov_len - seg_offset, length - filled);
+			memcpy(urb->transfer_buffer + filled,
+			       vec[seg].iov_base + seg_offset, n);
+			seg_offset += n;
+			if (seg_offset == vec[seg].iov_len) {
+				seg++;
+				seg_offset = 0;
+			}
+		}
+		urb->transfer_buffer_length = length;
+
+		trigger6_capture(trigger6, TRIGGER6_CAPTURE_SESSION, session,
+				 sizeof(struct trigger6_session));
+		trigger6_capture(trigger6, TRIGGER6_CAPTURE_FRAGMENT,
+				 urb->transfer_buffer, length);
+
+		ret = trigger6_submit_urb(trigger6, urb);
+		if (ret < 0)
+			break;
+
+		offset += length;
+	}
+
+	err = trigger6_wait_urbs(trigger6);
+	if (!ret)
+		ret = err;
+	if (ret < 0) {
+		drm_warn(&trigger6->drm, "Frame transfer failed: %d", ret);
+	} else {
+		trigger6->last_frame_ns = ktime_to_ns(ktime_sub(ktime_get(),
+								start));
+		trigger6->last_frame_bytes = payload_length;
 	}
 
-	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
-free_transfer_buffer:
-	vfree(transfer_buffer);
-dev_exit:
+unlock:
+	mutex_unlock(&trigger6->transfer_lock);
 	drm_dev_exit(idx);
-}
\ No newline at end of file
+	return ret;
+}
+
+int trigger6_send_payload(struct trigger6_device *trigger6,
+			  const struct kvec *vec, unsigned int nr_segs)
+{
+	return trigger6_stream_payload(trigger6, vec, nr_segs, NULL, NULL);
+}
+
+/* Fragments longer than the default are untested on real devices */
+static const u32 trigger6_tune_lengths[] = { 0x4000, 0x8000, 0x10000,
+					     0x19000 };
+static const u32 trigger6_tune_depths[] = { 2, 4, 8, 16 };
+
+/* Frames sent per setting, the fastest one counts */
+#define TRIGGER6_TUNE_SAMPLES 2
+
+/*
+ * Resend the staged frame with the current tunables and store its best
+ * time in ns. Fails with -EBUSY once the output has gone away.
+ */
+static int trigger6_probe_transfer(struct trigger6_device *trigger6, u64 *ns)
+{
+	int i, ret;
+
+	*ns = U64_MAX;
+	for (i = 0; i < TRIGGER6_TUNE_SAMPLES; i++) {
+		/* Let commits and other senders in between samples */
+		mutex_lock(&trigger6->frame_lock);
+		if (!trigger6->output_enabled || trigger6->suspended ||
+		    trigger6->disconnected || !trigger6->frame_length)
+			ret = -EBUSY;
+		else
+			ret = trigger6_send_frame(trigger6);
+		if (ret >= 0)
+			*ns = min(*ns, trigger6->last_frame_ns);
+		mutex_unlock(&trigger6->frame_lock);
+
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Pick the fragment length and then the depth that move the staged frame
+ * the fastest. Runs after the mode set has been committed.
+ */
+static void trigger6_autotune_work(struct work_struct *work)
+{
+	struct trigger6_device *trigger6 =
+		container_of(work, struct trigger6_device, autotune_work);
+	u32 old_length = READ_ONCE(trigger6->fragment_length);
+	u32 old_depth = READ_ONCE(trigger6->urb_depth);
+	u32 best_length = old_length, best_depth = old_depth;
+	u64 ns, best_ns = U64_MAX;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(trigger6_tune_lengths); i++) {
+		WRITE_ONCE(trigger6->fragment_length, trigger6_tune_lengths[i]);
+		ret = trigger6_probe_transfer(trigger6, &ns);
+		if (ret < 0)
+			goto restore;
+		if (ns < best_ns) {
+			best_ns = ns;
+			best_length = trigger6_tune_lengths[i];
+		}
+	}
+	WRITE_ONCE(trigger6->fragment_length, best_length);
+
+	for (i = 0; i < ARRAY_SIZE(trigger6_tune_depths); i++) {
+		WRITE_ONCE(trigger6->urb_depth, trigger6_tune_depths[i]);
+		ret = trigger6_probe_transfer(trigger6, &ns);
+		if (ret < 0)
+			goto restore;
+		if (ns < best_ns) {
+			best_ns = ns;
+			best_depth = trigger6_tune_depths[i];
+		}
+	}
+	WRITE_ONCE(trigger6->urb_depth, best_depth);
+
+	drm_info(&trigger6->drm,
+		 "autotune: fragment %u bytes, depth %u, %llu us per frame\n",
+		 best_length, best_depth, div_u64(best_ns, NSEC_PER_USEC));
+	return;
+
+restore:
+	WRITE_ONCE(trigger6->fragment_length, old_length);
+	WRITE_ONCE(trigger6->urb_depth, old_depth);
+	drm_dbg(&trigger6->drm, "autotune aborted: %d\n", ret);
+}
+
+void trigger6_transfer_init(struct trigger6_device *trigger6)
+{
+	init_usb_anchor(&trigger6->urb_anchor);
+	trigger6->fragment_length = fragment_length;
+	trigger6->urb_depth = urb_depth;
+	trigger6->autotune = autotune;
+	INIT_WORK(&trigger6->autotune_work, trigger6_autotune_work);
+}